@@ -1,4 +1,7 @@
 #include <math.h>       // NAN
+#include <algorithm>    // partial_sort, sort
+#include <bitset>
+#include <memory>       // unique_ptr
 #include <utility>      // move
 #include <sstream>      // istringstream
 #include <stdexcept>    // runtime_error
@@ -14,13 +17,8 @@ using std::move;
 using util::sprint_all;
 
 
-void check_num_vars(int num_vars)
+void check_num_vars(int num_vars, int max_vars)
 {
-    // The index type (int) must allow to represent column numbers up to
-    // 2**num_vars. For signed int MAXINT = 2**(8*sizeof(int)-1)-1,
-    // therefore the following is the best we can do (and 30 or so random
-    // variables are probably already too much to handle anyway):
-    int max_vars = 8*sizeof(int) - 2;
     if (num_vars > max_vars) {
         // Note that the base class destructor ~LinearProblem will still be
         // executed, thus freeing the allocated resource.
@@ -41,9 +39,11 @@ int skip_bit(int pool, int bit_index)
 }
 
 
-void add_elemental_inequalities(glp_prob* lp, int num_vars)
+// Call 'emit(len, indices, values)' for each elemental inequality. The
+// arrays use 1-based indices like GLPK, i.e. the 0th element is unused.
+template <class F>
+void for_each_elemental_inequality(int num_vars, F emit)
 {
-    // NOTE: GLPK uses 1-based indices and never uses the 0th element.
     int indices[5];
     double values[5];
     int i, a, b;
@@ -51,9 +51,7 @@ void add_elemental_inequalities(glp_prob* lp, int num_vars)
     if (num_vars == 1) {
         indices[1] = 1;
         values[1] = 1;
-        int row = glp_add_rows(lp, 1);
-        glp_set_row_bnds(lp, row, GLP_LO, 0.0, NAN);
-        glp_set_mat_row(lp, row, 1, indices, values);
+        emit(1, indices, values);
         return;
     }
 
@@ -82,9 +80,7 @@ void add_elemental_inequalities(glp_prob* lp, int num_vars)
         indices[2] = c;
         values[1] = +1;
         values[2] = -1;
-        int row = glp_add_rows(lp, 1);
-        glp_set_row_bnds(lp, row, GLP_LO, 0.0, NAN);
-        glp_set_mat_row(lp, row, 2, indices, values);
+        emit(2, indices, values);
     }
 
     // Add all elemental conditional mutual information positivities, i.e.
@@ -103,20 +99,29 @@ void add_elemental_inequalities(glp_prob* lp, int num_vars)
                 values[2] = +1;
                 values[3] = -1;
                 values[4] = -1;
-                int row = glp_add_rows(lp, 1);
-                glp_set_row_bnds(lp, row, GLP_LO, 0.0, NAN);
-                glp_set_mat_row(lp, row, K ? 4 : 3, indices, values);
+                emit(K ? 4 : 3, indices, values);
             }
         }
     }
 }
 
 
+void add_elemental_inequalities(glp_prob* lp, int num_vars)
+{
+    for_each_elemental_inequality(num_vars,
+            [lp](int len, const int* indices, const double* values) {
+        int row = glp_add_rows(lp, 1);
+        glp_set_row_bnds(lp, row, GLP_LO, 0.0, NAN);
+        glp_set_mat_row(lp, row, len, indices, values);
+    });
+}
+
+
 //----------------------------------------
 // ParserOutput
 //----------------------------------------
 
-double SparseVector::get(int i) const
+double SparseVector::get(SetIndex i) const
 {
     auto&& it = entries.find(i);
     if (it != entries.end())
@@ -124,7 +129,7 @@ double SparseVector::get(int i) const
     return 0;
 }
 
-void SparseVector::inc(int i, double v)
+void SparseVector::inc(SetIndex i, double v)
 {
     entries[i] += v;
 }
@@ -139,8 +144,8 @@ void ParserOutput::add_term(SparseVector& v, const ast::Term& t, double scale)
         return;
     }
 
-    // Need to index 2**num_parts subsets. For more detailed reasoning see
-    // the check_num_vars() function.
+    // The 2**num_parts subsets of the parts are enumerated below with an
+    // int bit mask, so 1 << num_parts must not overflow:
     int max_parts = 8*sizeof(int) - 2;
     if (num_parts > max_parts) {
         throw std::runtime_error(sprint_all(
@@ -161,17 +166,17 @@ void ParserOutput::add_term(SparseVector& v, const ast::Term& t, double scale)
     //
     // See: http://en.wikipedia.org/wiki/Multivariate_mutual_information
 
-    std::vector<int> set_indices(num_parts);
+    std::vector<SetIndex> set_indices(num_parts);
     for (int i = 0; i < num_parts; ++i)
         set_indices[i] = get_set_index(q.parts[i]);
 
     int num_subsets = 1 << num_parts;
-    int c = get_set_index(q.cond);
+    SetIndex c = get_set_index(q.cond);
     // Start at i=1 because i=0 which corresponds to H(empty set) gives no
     // contribution to the sum. Furthermore, the i=0 is already reserved
     // for the constant term for our purposes.
     for (int set = 1; set < num_subsets; ++set) {
-        int a = 0;
+        SetIndex a = 0;
         int s = -1;
         for (int i = 0; i < num_parts; ++i) {
             if (set & 1<<i) {
@@ -191,17 +196,17 @@ int ParserOutput::get_var_index(const std::string& s)
     if (it != vars.end())
         return it->second;
     int next_index = var_names.size();
-    check_num_vars(next_index + 1);
+    check_num_vars(next_index + 1, LazyShannonProblem::max_vars);
     vars[s] = next_index;
     var_names.push_back(s);
     return next_index;
 }
 
-int ParserOutput::get_set_index(const ast::VarList& l)
+SetIndex ParserOutput::get_set_index(const ast::VarList& l)
 {
-    int idx = 0;
+    SetIndex idx = 0;
     for (auto&& v : l)
-        idx |= 1 << get_var_index(v);
+        idx |= SetIndex(1) << get_var_index(v);
     return idx;
 }
 
@@ -237,11 +242,11 @@ void ParserOutput::mutual_independence(ast::MutualIndependence mi)
 {
     bool is_inquiry = inquiries.empty();
     // 0 = H(a) + H(b) + H(c) + … - H(a,b,c,…)
-    int all = 0;
+    SetIndex all = 0;
     SparseVector v;
     v.is_equality = true;
     for (auto&& vl : mi) {
-        int idx = get_set_index(vl);
+        SetIndex idx = get_set_index(vl);
         all |= idx;
         v.inc(idx, 1);
     }
@@ -252,9 +257,9 @@ void ParserOutput::mutual_independence(ast::MutualIndependence mi)
 void ParserOutput::markov_chain(ast::MarkovChain mc)
 {
     bool is_inquiry = inquiries.empty();
-    int a = 0;
+    SetIndex a = 0;
     for (int i = 0; i+2 < mc.size(); ++i) {
-        int b, c;
+        SetIndex b, c;
         a |= get_set_index(mc[i+0]);
         b = get_set_index(mc[i+1]);
         c = get_set_index(mc[i+2]);
@@ -272,8 +277,8 @@ void ParserOutput::markov_chain(ast::MarkovChain mc)
 void ParserOutput::function_of(ast::FunctionOf fo)
 {
     bool is_inquiry = inquiries.empty();
-    int func = get_set_index(fo.function);
-    int of = get_set_index(fo.of);
+    SetIndex func = get_set_index(fo.function);
+    SetIndex of = get_set_index(fo.of);
     // 0 = H(func|of) = H(func,of) - H(of)
     SparseVector v;
     v.is_equality = true;
@@ -282,6 +287,23 @@ void ParserOutput::function_of(ast::FunctionOf fo)
     add_relation(move(v), is_inquiry);
 }
 
+void ParserOutput::push_scope()
+{
+    // the first relation is the inquiry, scopes only apply to constraints:
+    if (inquiries.empty())
+        throw std::runtime_error("'{' before the information expression");
+    open_scopes.push_back(++num_scopes);
+    scopes.push_back({constraints.size(), true, num_scopes});
+}
+
+void ParserOutput::pop_scope()
+{
+    if (open_scopes.empty())
+        throw std::runtime_error("unmatched '}'");
+    scopes.push_back({constraints.size(), false, open_scopes.back()});
+    open_scopes.pop_back();
+}
+
 
 //----------------------------------------
 // LinearProblem
@@ -304,15 +326,28 @@ LinearProblem::~LinearProblem()
     glp_delete_prob(lp);
 }
 
-void LinearProblem::add_columns(int num_cols)
+int LinearProblem::add_columns(int num_cols)
 {
-    glp_add_cols(lp, num_cols);
-    for (int i = 1; i <= num_cols; ++i) {
+    int first = glp_add_cols(lp, num_cols);
+    for (int i = first; i < first + num_cols; ++i) {
         glp_set_col_bnds(lp, i, GLP_LO, 0, NAN);
     }
+    return first;
+}
+
+int LinearProblem::column(SetIndex i)
+{
+    return i;
 }
 
-void LinearProblem::add(const SparseVector& v)
+int LinearProblem::add(const SparseVector& v)
+{
+    int row = glp_add_rows(lp, 1);
+    set(row, v);
+    return row;
+}
+
+void LinearProblem::set(int row, const SparseVector& v)
 {
     std::vector<int> indices;
     std::vector<double> values;
@@ -321,18 +356,66 @@ void LinearProblem::add(const SparseVector& v)
     for (auto&& ent : v.entries) {
         if (ent.first == 0)
             continue;
-        indices.push_back(ent.first);
+        indices.push_back(column(ent.first));
         values.push_back(ent.second);
     }
 
     int kind = v.is_equality ? GLP_FX : GLP_LO;
-    int row = glp_add_rows(lp, 1);
     glp_set_row_bnds(lp, row, kind, -v.get(0), NAN);
     glp_set_mat_row(
             lp, row, indices.size(),
             indices.data()-1, values.data()-1);
 }
 
+void LinearProblem::push()
+{
+    scopes.push_back(glp_get_num_rows(lp));
+}
+
+void LinearProblem::pop()
+{
+    if (scopes.empty())
+        throw std::logic_error("LinearProblem::pop() without push()");
+    int first = scopes.back() + 1;
+    int last = glp_get_num_rows(lp);
+    scopes.pop_back();
+    if (first > last)
+        return;
+
+    // Deleting rows with a basic auxiliary variable keeps the basis valid.
+    // For each deleted row whose auxiliary variable was non-basic (i.e.
+    // the constraint was binding), one structural variable too many
+    // remains basic:
+    std::vector<int> rows(1);
+    int excess = 0;
+    for (int i = first; i <= last; ++i) {
+        rows.push_back(i);
+        if (glp_get_row_stat(lp, i) != GLP_BS)
+            ++excess;
+    }
+    glp_del_rows(lp, rows.size()-1, rows.data());
+    if (excess == 0)
+        return;
+
+    // Repair the basis by making the basic columns with the smallest
+    // values non-basic, which keeps the rest of the basis. Should this
+    // make the basis singular, solve() starts over from a fresh one:
+    std::vector<std::pair<double, int>> basic;
+    int num_cols = glp_get_num_cols(lp);
+    for (int j = 1; j <= num_cols; ++j) {
+        if (glp_get_col_stat(lp, j) == GLP_BS)
+            basic.emplace_back(glp_get_col_prim(lp, j), j);
+    }
+    // (fewer basic columns only occur if the basis was invalid already)
+    excess = std::min(excess, int(basic.size()));
+    std::partial_sort(basic.begin(), basic.begin() + excess, basic.end());
+    for (int i = 0; i < excess; ++i) {
+        int j = basic[i].second;
+        int stat = glp_get_col_type(lp, j) == GLP_FX ? GLP_NS : GLP_NL;
+        glp_set_col_stat(lp, j, stat);
+    }
+}
+
 bool LinearProblem::check(const SparseVector& v)
 {
     // check for equalities as I>=0 and -I>=0
@@ -346,31 +429,22 @@ bool LinearProblem::check(const SparseVector& v)
         return check(v2);
     }
 
-    glp_smcp parm;
-    glp_init_smcp(&parm);
-    parm.msg_lev = GLP_MSG_ERR;
-
-    int num_cols = glp_get_num_cols(lp);
-
-    for (int i = 1; i <= num_cols; ++i)
-        glp_set_obj_coef(lp, i, v.get(i));
-
-    int outcome = glp_simplex(lp, &parm);
-    if (outcome != 0) {
-        throw std::runtime_error(sprint_all(
-                    "Error in glp_simplex: ", outcome));
-    }
+    // the original check was for the solution (primal variable values)
+    // rather than objective value, but let's do it simpler for now (if
+    // an optimum is found, it should be zero anyway):
+    return minimize(v) >= 0;
+}
 
-    int status = glp_get_status(lp);
+double LinearProblem::minimize(const SparseVector& v)
+{
+    set_objective(v);
+    int status = solve();
     if (status == GLP_OPT) {
-        // the original check was for the solution (primal variable values)
-        // rather than objective value, but let's do it simpler for now (if
-        // an optimum is found, it should be zero anyway):
-        return glp_get_obj_val(lp) >= -v.get(0);
+        return glp_get_obj_val(lp) + v.get(0);
     }
 
     if (status == GLP_UNBND) {
-        return false;
+        return -INFINITY;
     }
 
     // I am not sure about the exact distinction of GLP_NOFEAS, GLP_INFEAS,
@@ -380,16 +454,584 @@ bool LinearProblem::check(const SparseVector& v)
                 ));
 }
 
+void LinearProblem::set_objective(const SparseVector& v)
+{
+    int num_cols = glp_get_num_cols(lp);
+    for (int i = 1; i <= num_cols; ++i)
+        glp_set_obj_coef(lp, i, 0);
+    for (auto&& ent : v.entries) {
+        if (ent.first != 0)
+            glp_set_obj_coef(lp, column(ent.first), ent.second);
+    }
+}
+
+int LinearProblem::solve()
+{
+    glp_smcp parm;
+    glp_init_smcp(&parm);
+    parm.msg_lev = GLP_MSG_ERR;
+
+    int outcome = glp_simplex(lp, &parm);
+
+    // The warm basis can become singular or ill-conditioned when rows are
+    // changed or removed. In this case, retry once from a fresh basis:
+    if (outcome == GLP_EBADB || outcome == GLP_ESING || outcome == GLP_ECOND) {
+        glp_adv_basis(lp, 0);
+        outcome = glp_simplex(lp, &parm);
+    }
+    if (outcome != 0) {
+        throw std::runtime_error(sprint_all(
+                    "Error in glp_simplex: ", outcome));
+    }
+    return glp_get_status(lp);
+}
+
+
+ProblemSize ShannonTypeProblem::estimate(int num_vars)
+{
+    // see for_each_elemental_inequality()
+    if (num_vars <= 1)
+        return {double(num_vars), double(num_vars), double(num_vars)};
+    double n = num_vars;
+    double pairs = n*(n-1)/2;
+    double sub_dim = ldexp(1, num_vars-2);
+    return {n + pairs*sub_dim,
+            ldexp(1, num_vars) - 1,
+            2*n + pairs*(4*sub_dim - 1)};
+}
 
 ShannonTypeProblem::ShannonTypeProblem(int num_vars)
     : LinearProblem()
 {
-    check_num_vars(num_vars);
+    // The index type (int) must allow to represent column numbers up to
+    // 2**num_vars. For signed int MAXINT = 2**(8*sizeof(int)-1)-1,
+    // therefore max_vars is the best we can do (and 30 or so random
+    // variables are probably already too much to handle anyway):
+    check_num_vars(num_vars, max_vars);
     add_columns((1<<num_vars) - 1);
     add_elemental_inequalities(lp, num_vars);
 }
 
 
+//----------------------------------------
+// LazyShannonProblem
+//----------------------------------------
+
+LazyShannonProblem::LazyShannonProblem(int num_vars, double budget)
+    : LinearProblem(), num_vars(num_vars), budget(budget)
+{
+    check_num_vars(num_vars, max_vars);
+    all = all_vars(num_vars);
+}
+
+ProblemSize LazyShannonProblem::estimate(
+        int num_vars, const std::set<SetIndex>& subsets)
+{
+    SetIndex all = all_vars(num_vars);
+    std::set<Elemental> rows;
+    std::vector<Elemental> elementals;
+    for (auto&& s : subsets) {
+        elementals.clear();
+        elementals_containing(num_vars, s, elementals);
+        rows.insert(elementals.begin(), elementals.end());
+    }
+    double nonzeros = 0;
+    SetIndex sets[4];
+    double values[4];
+    for (auto&& e : rows) {
+        int len = elemental_terms(all, e, sets, values);
+        for (int i = 0; i < len; ++i)
+            nonzeros += subsets.count(sets[i]);
+    }
+    return {double(rows.size()), double(subsets.size()), nonzeros};
+}
+
+void LazyShannonProblem::set(int row, const SparseVector& v)
+{
+    LinearProblem::set(row, v);
+
+    // The zero vector is feasible for homogeneous constraints. Others get
+    // an artificial column to make the restricted problem feasible:
+    int have = 0;
+    for (auto&& a : artificial) {
+        if (a.row == row) {
+            ++have;
+            // restore the entry that was just overwritten
+            int indices[2] = {0, row};
+            double values[2] = {0, a.value};
+            glp_set_mat_col(lp, a.col, 1, indices, values);
+        }
+    }
+    int need = v.get(0) == 0 ? 0 : v.is_equality ? 2 : 1;
+    for (int i = have; i < need; ++i) {
+        Artificial a = {row, add_columns(1), i == 0 ? 1.0 : -1.0};
+        int indices[2] = {0, row};
+        double values[2] = {0, a.value};
+        glp_set_mat_col(lp, a.col, 1, indices, values);
+        glp_set_col_bnds(lp, a.col, GLP_FX, 0, 0);
+        artificial.push_back(a);
+    }
+}
+
+void LazyShannonProblem::push()
+{
+    LinearProblem::push();
+    marks.emplace_back(new_columns.size(), new_rows.size());
+}
+
+void LazyShannonProblem::pop()
+{
+    LinearProblem::pop();
+    int num_rows = glp_get_num_rows(lp);
+    size_t first_col = marks.back().first;
+    size_t first_row = marks.back().second;
+    marks.pop_back();
+
+    // forget about the deleted rows, which are exactly the elemental rows
+    // created inside the scope (and the constraints):
+    for (size_t i = first_row; i < new_rows.size(); ++i)
+        rows.erase(new_rows[i]);
+    new_rows.resize(first_row);
+    for (auto it = artificial.begin(); it != artificial.end(); ) {
+        if (it->row > num_rows) {
+            glp_set_col_bnds(lp, it->col, GLP_FX, 0, 0);
+            it = artificial.erase(it);
+        }
+        else {
+            ++it;
+        }
+    }
+
+    // Columns that were generated inside the scope are kept, but some of
+    // their elemental inequalities may have been deleted. Rows that still
+    // exist are up to date. The columns now belong to the enclosing scope:
+    for (size_t i = first_col; i < new_columns.size(); ++i)
+        restore_elemental_rows(new_columns[i]);
+    if (marks.empty()) {
+        new_columns.clear();
+        new_rows.clear();
+    }
+}
+
+int LazyShannonProblem::column(SetIndex s)
+{
+    auto&& it = columns.find(s);
+    if (it != columns.end())
+        return it->second;
+    int col = add_columns(1);
+    columns[s] = col;
+    if (!marks.empty())
+        new_columns.push_back(s);
+    add_elemental_rows(s);
+    return col;
+}
+
+void LazyShannonProblem::set_objective(const SparseVector& v)
+{
+    // Columns for all subsets of the objective are created here, so the
+    // objective coefficient of every missing column is zero.
+    objective = v;
+    LinearProblem::set_objective(v);
+}
+
+int LazyShannonProblem::solve()
+{
+    if (!artificial.empty()) {
+        // phase 1: minimize the sum of artificial variables
+        int num_cols = glp_get_num_cols(lp);
+        for (int i = 1; i <= num_cols; ++i)
+            glp_set_obj_coef(lp, i, 0);
+        for (auto&& a : artificial) {
+            glp_set_col_bnds(lp, a.col, GLP_LO, 0, NAN);
+            glp_set_obj_coef(lp, a.col, 1);
+        }
+        int status = generate_columns();
+        if (status != GLP_OPT || glp_get_obj_val(lp) > 1e-9)
+            return GLP_NOFEAS;
+        for (auto&& a : artificial)
+            glp_set_col_bnds(lp, a.col, GLP_FX, 0, 0);
+        LinearProblem::set_objective(objective);
+    }
+    return generate_columns();
+}
+
+int LazyShannonProblem::generate_columns()
+{
+    int status;
+    do {
+        status = LinearProblem::solve();
+    } while (status == GLP_OPT && price());
+    return status;
+}
+
+bool LazyShannonProblem::price()
+{
+    // The reduced cost of a missing column S is d_S = - Σ y_k a_kS, summed
+    // over all rows k with dual value y_k, since its objective coefficient
+    // is zero. Only elemental inequalities can involve missing columns and
+    // rows that are not yet part of the problem have dual value zero.
+    std::map<SetIndex, double> reduced_cost;
+    SetIndex sets[4];
+    double values[4];
+    for (auto&& row : rows) {
+        double dual = glp_get_row_dual(lp, row.second);
+        if (dual == 0)
+            continue;
+        int len = elemental_terms(all, row.first, sets, values);
+        for (int i = 0; i < len; ++i) {
+            if (columns.find(sets[i]) == columns.end())
+                reduced_cost[sets[i]] -= dual * values[i];
+        }
+    }
+
+    // Since missing columns count as zero, H(S)>0 only pays off once all
+    // supersets of S are present as well. Adding S alone would discover
+    // them one layer per round. Instead, add the upward closure of each
+    // improving column as a whole, smallest first, as long as the columns
+    // are expected to fit into the budget (judging by the current average
+    // memory per column). Otherwise, add only the column itself:
+    std::vector<std::pair<double, SetIndex>> improving;
+    for (auto&& ent : reduced_cost) {
+        if (ent.second < -1e-9) {
+            int size = std::bitset<max_vars>(ent.first).count();
+            improving.emplace_back(ldexp(1, num_vars - size), ent.first);
+        }
+    }
+    std::sort(improving.begin(), improving.end());
+    double allowance = columns.size();
+    if (budget != 0) {
+        double memory = current_size().memory();
+        allowance = std::min(allowance,
+                             (budget - memory) / memory * columns.size());
+    }
+    for (auto&& ent : improving) {
+        if (ent.first <= allowance) {
+            allowance -= ent.first;
+            add_upward_closure(ent.second);
+        }
+        else {
+            column(ent.second);
+            check_budget();
+        }
+    }
+    return !improving.empty();
+}
+
+void LazyShannonProblem::add_upward_closure(SetIndex s)
+{
+    SetIndex rest = all & ~s;
+    for (SetIndex sub = rest; ; sub = (sub - 1) & rest) {
+        column(s | sub);
+        check_budget();
+        if (sub == 0)
+            break;
+    }
+}
+
+ProblemSize LazyShannonProblem::current_size() const
+{
+    return {double(glp_get_num_rows(lp)),
+            double(glp_get_num_cols(lp)),
+            double(glp_get_num_nz(lp))};
+}
+
+void LazyShannonProblem::check_budget() const
+{
+    if (budget != 0 && current_size().memory() > budget) {
+        throw std::runtime_error(sprint_all(
+                    "Memory budget exceeded during column generation ",
+                    "after creating ", columns.size(), " columns."));
+    }
+}
+
+void LazyShannonProblem::add_elemental_rows(SetIndex s)
+{
+    std::vector<Elemental> elementals;
+    elementals_containing(num_vars, s, elementals);
+    for (auto&& e : elementals) {
+        auto&& it = rows.find(e);
+        if (it != rows.end())
+            set_elemental_row(it->second, e);
+        else
+            add_elemental_row(e);
+    }
+}
+
+void LazyShannonProblem::restore_elemental_rows(SetIndex s)
+{
+    std::vector<Elemental> elementals;
+    elementals_containing(num_vars, s, elementals);
+    for (auto&& e : elementals) {
+        if (rows.find(e) == rows.end())
+            add_elemental_row(e);
+    }
+}
+
+int LazyShannonProblem::add_elemental_row(const Elemental& e)
+{
+    int row = glp_add_rows(lp, 1);
+    glp_set_row_bnds(lp, row, GLP_LO, 0.0, NAN);
+    rows[e] = row;
+    if (!marks.empty())
+        new_rows.push_back(e);
+    set_elemental_row(row, e);
+    return row;
+}
+
+SetIndex LazyShannonProblem::all_vars(int num_vars)
+{
+    // avoid shifting by the full width of SetIndex:
+    return num_vars ? ~SetIndex(0) >> (max_vars - num_vars) : 0;
+}
+
+// Collect all elemental inequalities that contain H(s):
+void LazyShannonProblem::elementals_containing(
+        int num_vars, SetIndex s, std::vector<Elemental>& elementals)
+{
+    SetIndex all = all_vars(num_vars);
+    SetIndex rest = all ^ s;
+    if (s == all) {
+        for (int i = 0; i < num_vars; ++i)
+            elementals.emplace_back(i, i, 0);
+    }
+    else if ((rest & (rest-1)) == 0) {      // exactly one bit
+        int i = 0;
+        while (rest >> i != 1)
+            ++i;
+        elementals.emplace_back(i, i, 0);
+    }
+    for (int a = 0; a < num_vars-1; ++a) {
+        for (int b = a+1; b < num_vars; ++b) {
+            SetIndex A = SetIndex(1) << a;
+            SetIndex B = SetIndex(1) << b;
+            // H(s) is one of H(A|K), H(B|K), H(A|B|K) or H(K):
+            elementals.emplace_back(a, b, s & ~(A|B));
+        }
+    }
+}
+
+void LazyShannonProblem::set_elemental_row(int row, const Elemental& e)
+{
+    // only consider the columns that exist
+    SetIndex sets[4];
+    double values[4];
+    int indices[5];
+    double present[5];
+    int len = elemental_terms(all, e, sets, values);
+    int num = 0;
+    for (int i = 0; i < len; ++i) {
+        auto&& it = columns.find(sets[i]);
+        if (it != columns.end()) {
+            ++num;
+            indices[num] = it->second;
+            present[num] = values[i];
+        }
+    }
+    glp_set_mat_row(lp, row, num, indices, present);
+}
+
+int LazyShannonProblem::elemental_terms(
+        SetIndex all, const Elemental& e, SetIndex* sets, double* values)
+{
+    int a = std::get<0>(e);
+    int b = std::get<1>(e);
+    SetIndex K = std::get<2>(e);
+    int len;
+    if (a == b) {
+        sets[0] = all;
+        sets[1] = all ^ (SetIndex(1) << a);
+        values[0] = +1;
+        values[1] = -1;
+        len = 2;
+    }
+    else {
+        SetIndex A = SetIndex(1) << a;
+        SetIndex B = SetIndex(1) << b;
+        sets[0] = A|K;
+        sets[1] = B|K;
+        sets[2] = A|B|K;
+        sets[3] = K;
+        values[0] = +1;
+        values[1] = +1;
+        values[2] = -1;
+        values[3] = -1;
+        len = 4;
+    }
+    // H(empty set) = 0 has no column:
+    if (sets[len-1] == 0)
+        --len;
+    return len;
+}
+
+
+//----------------------------------------
+// ShannonCone
+//----------------------------------------
+
+namespace
+{
+    // Intermediate ray during the double description method. 'zeros' has
+    // a bit set for every inequality that is satisfied with equality.
+    struct Ray
+    {
+        std::vector<long long> x;
+        uint64_t zeros;
+    };
+
+    long long gcd(long long a, long long b)
+    {
+        while (b) {
+            long long t = a % b;
+            a = b;
+            b = t;
+        }
+        return a;
+    }
+}
+
+void check_cone_vars(int num_vars)
+{
+    if (num_vars < 1 || num_vars > ShannonCone::max_vars) {
+        throw std::runtime_error(sprint_all(
+                    "Extreme rays are only available for 1 to ",
+                    ShannonCone::max_vars, " variables."));
+    }
+}
+
+ShannonCone::ShannonCone(int num_vars)
+{
+    check_cone_vars(num_vars);
+    dim = (1<<num_vars) - 1;
+
+    // The Shannon cone is contained in the nonnegative orthant, so we can
+    // start with the orthant's rays and cut it down by intersecting with
+    // one elemental inequality at a time. The tight sets are stored in a
+    // 64 bit mask, which suffices for the dim + 28 inequalities at N=4.
+    std::vector<Ray> rays;
+    for (int i = 0; i < dim; ++i) {
+        Ray r;
+        r.x.assign(dim, 0);
+        r.x[i] = 1;
+        r.zeros = ((uint64_t(1) << dim) - 1) ^ (uint64_t(1) << i);
+        rays.push_back(move(r));
+    }
+    int num_ineqs = dim;
+
+    for_each_elemental_inequality(num_vars,
+            [&](int len, const int* indices, const double* values) {
+        uint64_t bit = uint64_t(1) << num_ineqs++;
+        std::vector<long long> dots(rays.size());
+        for (size_t r = 0; r < rays.size(); ++r) {
+            for (int k = 1; k <= len; ++k)
+                dots[r] += (long long) values[k] * rays[r].x[indices[k]-1];
+        }
+
+        std::vector<Ray> next;
+        for (size_t r = 0; r < rays.size(); ++r) {
+            if (dots[r] >= 0) {
+                next.push_back(rays[r]);
+                if (dots[r] == 0)
+                    next.back().zeros |= bit;
+            }
+        }
+
+        // Combine each pair of adjacent rays on opposite sides of the new
+        // hyperplane. Two rays are adjacent iff no third ray is tight on
+        // all the inequalities that both of them are tight on:
+        for (size_t p = 0; p < rays.size(); ++p) {
+            if (dots[p] <= 0)
+                continue;
+            for (size_t n = 0; n < rays.size(); ++n) {
+                if (dots[n] >= 0)
+                    continue;
+                uint64_t common = rays[p].zeros & rays[n].zeros;
+                bool adjacent = true;
+                for (size_t o = 0; o < rays.size() && adjacent; ++o) {
+                    if (o != p && o != n && (common & ~rays[o].zeros) == 0)
+                        adjacent = false;
+                }
+                if (!adjacent)
+                    continue;
+                Ray r;
+                r.x.resize(dim);
+                long long g = 0;
+                for (int i = 0; i < dim; ++i) {
+                    r.x[i] = dots[p] * rays[n].x[i] - dots[n] * rays[p].x[i];
+                    g = gcd(g, r.x[i]);
+                }
+                for (int i = 0; i < dim; ++i)
+                    r.x[i] /= g;
+                r.zeros = common | bit;
+                next.push_back(move(r));
+            }
+        }
+        rays = move(next);
+    });
+
+    // store as dense table, padding each row with zeros. std::vector
+    // only guarantees the alignment of double, so allocate 3 extra slots
+    // and start at the first 32 byte boundary:
+    const size_t alignment = 32;
+    stride = (dim + 3) & ~3;
+    num = rays.size();
+    size_t size = num * stride * sizeof(double);
+    storage.assign(num * stride + 3, 0.0);
+    void* start = storage.data();
+    size_t space = storage.size() * sizeof(double);
+    double* table = static_cast<double*>(
+            std::align(alignment, size, start, space));
+    for (int r = 0; r < num; ++r) {
+        for (int i = 0; i < dim; ++i)
+            table[r*stride + i] = rays[r].x[i];
+    }
+    this->rays = table;
+}
+
+const ShannonCone& ShannonCone::get(int num_vars)
+{
+    static std::unique_ptr<ShannonCone> cache[max_vars+1];
+    check_cone_vars(num_vars);
+    if (!cache[num_vars])
+        cache[num_vars].reset(new ShannonCone(num_vars));
+    return *cache[num_vars];
+}
+
+bool ShannonCone::check(const SparseVector& v) const
+{
+    // Same treatment of the constant term as in LinearProblem::check: the
+    // minimum over the cone is zero (attained at the origin) or -infinity.
+    double constant = v.get(0);
+    if (constant < 0 || (v.is_equality && constant > 0))
+        return false;
+
+    std::vector<double> dense(stride, 0.0);
+    for (auto&& ent : v.entries) {
+        if (ent.first == 0)
+            continue;
+        if (ent.first > SetIndex(dim))
+            throw std::logic_error("Index out of range for ShannonCone.");
+        dense[ent.first-1] = ent.second;
+    }
+
+    // Keep one partial sum per component of a 4-block, so the compiler
+    // can map the blocks onto SIMD registers without reassociating the
+    // floating point additions (which it would only do with -ffast-math):
+    const double eps = 1e-9;
+    const double* x = dense.data();
+    for (const double* r = rays; r != rays + num*stride; r += stride) {
+        double sum[4] = {0, 0, 0, 0};
+        for (int i = 0; i < stride; i += 4) {
+            for (int k = 0; k < 4; ++k)
+                sum[k] += r[i+k] * x[i+k];
+        }
+        double dot = (sum[0] + sum[1]) + (sum[2] + sum[3]);
+        if (dot < -eps || (v.is_equality && dot > eps))
+            return false;
+    }
+    return true;
+}
+
+
 //----------------------------------------
 // globals
 //----------------------------------------
@@ -428,21 +1070,227 @@ ParserOutput parse(const std::vector<std::string>& exprs)
     if (out.inquiries.empty()) {
         throw std::runtime_error("undefined information expression");
     }
+    if (!out.open_scopes.empty()) {
+        throw std::runtime_error("unmatched '{'");
+    }
     return move(out);
 }
 
 
+// Rough cost of GLPK's problem object plus the working copy made by the
+// simplex solver. Only meant to keep off problems that can never fit.
+const double bytes_per_row = 200;
+const double bytes_per_col = 200;
+const double bytes_per_nonzero = 80;
+
+double ProblemSize::memory() const
+{
+    return rows * bytes_per_row
+        + cols * bytes_per_col
+        + nonzeros * bytes_per_nonzero;
+}
+
+ProblemSize estimate(const ParserOutput& out, bool lazy)
+{
+    int num_vars = out.var_names.size();
+    ProblemSize size;
+    if (lazy) {
+        std::set<SetIndex> subsets;
+        for (auto&& v : out.constraints)
+            for (auto&& ent : v.entries)
+                if (ent.first)
+                    subsets.insert(ent.first);
+        for (auto&& v : out.inquiries)
+            for (auto&& ent : v.entries)
+                if (ent.first)
+                    subsets.insert(ent.first);
+        size = LazyShannonProblem::estimate(num_vars, subsets);
+    }
+    else {
+        size = ShannonTypeProblem::estimate(num_vars);
+    }
+    for (auto&& v : out.constraints) {
+        size.rows += 1;
+        size.nonzeros += v.entries.size() - (v.get(0) != 0);
+        // artificial columns, see LazyShannonProblem::set():
+        if (lazy && v.get(0) != 0) {
+            int num = v.is_equality ? 2 : 1;
+            size.cols += num;
+            size.nonzeros += num;
+        }
+    }
+    return size;
+}
+
+bool select_lazy(const ParserOutput& out, double budget)
+{
+    int num_vars = out.var_names.size();
+    if (num_vars <= ShannonTypeProblem::max_vars) {
+        if (budget == 0 || estimate(out, false).memory() <= budget)
+            return false;
+    }
+    double memory = estimate(out, true).memory();
+    if (budget != 0 && memory > budget) {
+        throw std::runtime_error(sprint_all(
+                    "Problem too large: estimated ", memory,
+                    " bytes exceed the budget of ", budget, " bytes."));
+    }
+    return true;
+}
+
+std::unique_ptr<LinearProblem> create_problem(
+        const ParserOutput& out, double budget)
+{
+    int num_vars = out.var_names.size();
+    if (select_lazy(out, budget))
+        return std::unique_ptr<LinearProblem>(
+                new LazyShannonProblem(num_vars, budget));
+    return std::unique_ptr<LinearProblem>(
+            new ShannonTypeProblem(num_vars));
+}
+
+
 // TODO: implement optimization as in Xitip: collapse variables that only
 // appear together
 
-bool check(const ParserOutput& out)
+// Add constraints [begin, end) to the problem.
+void add_constraints(LinearProblem& prob, const Matrix& constraints,
+                     size_t begin, size_t end)
 {
-    ShannonTypeProblem prob(out.var_names.size());
-    for (auto&& constraint : out.constraints)
-        prob.add(constraint);
-    for (auto&& inquiry : out.inquiries) {
+    for (size_t i = begin; i < end; ++i)
+        prob.add(constraints[i]);
+}
+
+// Add all constraints outside of any scope to the problem. Returns the row
+// of each constraint, or 0 for constraints that are enclosed in a scope.
+std::vector<int> add_top_level(LinearProblem& prob, const ParserOutput& out)
+{
+    std::vector<int> rows(out.constraints.size());
+    size_t pos = 0;
+    int depth = 0;
+    for (auto&& ev : out.scopes) {
+        for (; pos < ev.pos; ++pos) {
+            if (depth == 0)
+                rows[pos] = prob.add(out.constraints[pos]);
+        }
+        depth += ev.push ? 1 : -1;
+    }
+    for (; pos < out.constraints.size(); ++pos)
+        rows[pos] = prob.add(out.constraints[pos]);
+    return rows;
+}
+
+bool check_inquiries(LinearProblem& prob, const Matrix& inquiries)
+{
+    for (auto&& inquiry : inquiries) {
         if (!prob.check(inquiry))
             return false;
     }
     return true;
 }
+
+bool check(const ParserOutput& out, double budget)
+{
+    // Unconstrained small problems can be decided without solving an LP:
+    int num_vars = out.var_names.size();
+    if (out.constraints.empty() &&
+            num_vars >= 1 && num_vars <= ShannonCone::max_vars) {
+        const ShannonCone& cone = ShannonCone::get(num_vars);
+        for (auto&& inquiry : out.inquiries) {
+            if (!cone.check(inquiry))
+                return false;
+        }
+        return true;
+    }
+
+    auto prob = create_problem(out, budget);
+    add_top_level(*prob, out);
+    return check_inquiries(*prob, out.inquiries);
+}
+
+std::vector<bool> check_scopes(const ParserOutput& out, double budget)
+{
+    auto prob = create_problem(out, budget);
+    std::vector<bool> results(out.num_scopes + 1);
+    size_t pos = 0;
+    for (auto&& ev : out.scopes) {
+        add_constraints(*prob, out.constraints, pos, ev.pos);
+        pos = ev.pos;
+        if (ev.push) {
+            prob->push();
+        }
+        else {
+            results[ev.scope - 1] = check_inquiries(*prob, out.inquiries);
+            prob->pop();
+        }
+    }
+    add_constraints(*prob, out.constraints, pos, out.constraints.size());
+    results.back() = check_inquiries(*prob, out.inquiries);
+    return results;
+}
+
+// Return the inquiry to be minimized, or throw if the minimum is not
+// well-defined for the given input:
+const SparseVector& single_inquiry(const ParserOutput& out)
+{
+    if (out.inquiries.size() != 1) {
+        throw std::runtime_error(
+                "Optimization requires a single information expression.");
+    }
+    if (out.inquiries[0].is_equality) {
+        throw std::runtime_error(
+                "Optimization requires an inequality, not an equation.");
+    }
+    if (!out.scopes.empty()) {
+        throw std::runtime_error(
+                "Optimization does not support scopes.");
+    }
+    return out.inquiries[0];
+}
+
+double optimize(const ParserOutput& out, double budget)
+{
+    const SparseVector& inquiry = single_inquiry(out);
+    auto prob = create_problem(out, budget);
+    add_top_level(*prob, out);
+    return prob->minimize(inquiry);
+}
+
+std::vector<double> sweep(const std::vector<std::string>& exprs,
+                          const std::vector<double>& values,
+                          double budget)
+{
+    std::unique_ptr<LinearProblem> prob;
+    std::vector<int> rows;
+    Matrix prev;
+    std::vector<double> results;
+    for (double value : values) {
+        // The grammar has no exponent notation, so print in fixed format:
+        std::ostringstream fmt;
+        fmt.precision(15);
+        fmt << std::fixed << value;
+        std::vector<std::string> lines(exprs);
+        for (auto&& line : lines) {
+            size_t pos;
+            while ((pos = line.find(sweep_param)) != std::string::npos)
+                line.replace(pos, 1, fmt.str());
+        }
+        ParserOutput out = parse(lines);
+
+        if (!prob) {
+            prob = create_problem(out, budget);
+            rows = add_top_level(*prob, out);
+        }
+        else {
+            for (size_t i = 0; i < rows.size(); ++i) {
+                const SparseVector& c = out.constraints[i];
+                if (rows[i] && (c.entries != prev[i].entries ||
+                                c.is_equality != prev[i].is_equality))
+                    prob->set(rows[i], c);
+            }
+        }
+        results.push_back(prob->minimize(single_inquiry(out)));
+        prev = move(out.constraints);
+    }
+    return results;
+}
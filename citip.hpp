@@ -1,8 +1,12 @@
 #ifndef __CITIP_HPP__INCLUDED__
 #define __CITIP_HPP__INCLUDED__
 
+# include <stdint.h>     // uint64_t
 # include <map>
+# include <memory>       // unique_ptr
+# include <set>
 # include <string>
+# include <tuple>
 # include <vector>
 
 # include "parser.hxx"
@@ -11,19 +15,47 @@
 struct glp_prob;                    // defined in <glpk.h>
 
 
+// Bit mask representing a subset of the random variables. Index 0 (the
+// empty set) is used for the constant term of a SparseVector.
+typedef uint64_t SetIndex;
+
+
 struct SparseVector
 {
-    std::map<int, double> entries;
+    std::map<SetIndex, double> entries;
     bool is_equality;
 
-    double get(int i) const;        // get component i
-    void inc(int i, double v);      // increase/decrease component
+    double get(SetIndex i) const;   // get component i
+    void inc(SetIndex i, double v); // increase/decrease component
 };
 
 
 typedef std::vector<SparseVector> Matrix;
 
 
+// Predicted size of a linear problem, as floating point numbers to cope
+// with exponential growth.
+struct ProblemSize
+{
+    double rows;
+    double cols;
+    double nonzeros;
+
+    double memory() const;          // rough estimate in bytes
+};
+
+
+// Position of a '{' (push) or '}' (pop) statement, given as the number of
+// constraints that precede it. Scopes are numbered from 1 in the order of
+// their opening '{', and both events of a scope carry its number.
+struct ScopeEvent
+{
+    size_t pos;
+    bool push;
+    int scope;
+};
+
+
 // Lightweight C++ wrapper for a GLPK problem (glp_prob*). This manages a
 // problem of the form "Is I>=0 valid, subject to the constraints C>=0, and
 // X>=0 for all column variables X".
@@ -32,18 +64,35 @@ class LinearProblem
 public:
     LinearProblem();
     explicit LinearProblem(int num_cols);
-    ~LinearProblem();
+    virtual ~LinearProblem();
 
-    void add_columns(int num_cols);
+    int add_columns(int num_cols);      // returns index of the first
 
     LinearProblem(const LinearProblem&) = delete;
     LinearProblem& operator = (const LinearProblem&) = delete;
 
-    void add(const SparseVector&);      // add a constraint C>=0
-    bool check(const SparseVector&);    // check if I>=0 is redundant
+    int add(const SparseVector&);           // add a constraint C>=0
+    virtual void set(int row, const SparseVector&); // replace a constraint
+    bool check(const SparseVector&);        // check if I>=0 is redundant
+
+    // Return the minimum of I subject to the constraints, i.e. the largest
+    // c such that I>=c is valid, or -inf if I is unbounded.
+    double minimize(const SparseVector&);
+
+    // Open/close a scope: pop() removes all constraints that were added
+    // since the matching push(). The current basis is kept as warm start
+    // for the next check() whenever it remains valid.
+    virtual void push();
+    virtual void pop();
 
 protected:
+    // map a vector component to its column, by default the identity
+    virtual int column(SetIndex);
+    virtual void set_objective(const SparseVector&);
+    virtual int solve();                // run simplex, return GLPK status
+
     glp_prob* lp;
+    std::vector<int> scopes;            // number of rows at each push()
 };
 
 
@@ -56,17 +105,134 @@ class ShannonTypeProblem
     : public LinearProblem
 {
 public:
+    // Column numbers up to 2**num_vars must be representable as int:
+    static const int max_vars = 8*sizeof(int) - 2;
+
     explicit ShannonTypeProblem(int num_vars);
+
+    // size of the elemental inequalities, without other constraints
+    static ProblemSize estimate(int num_vars);
 };
 
 // This is used automatically for a ShannonTypeProblem.
 void add_elemental_inequalities(glp_prob* lp, int num_vars);
 
 
+// Shannon-type problem with column generation for many variables. Columns
+// are only created for the subsets that appear in constraints and
+// inquiries, along with the elemental inequalities that involve them. All
+// other joint entropies are implicitly zero. After solving this restricted
+// problem, the reduced cost of each missing column is computed from the
+// row duals and the columns with negative reduced cost are added, until
+// none is left. This is exact and cheap for valid inequalities with a
+// small proof. However, since H(S)>0 requires H(T)>0 for all 2**(n-|S|)
+// supersets T of S, refuting an inequality or finding a positive minimum
+// needs all of these columns. They are added in whole batches where the
+// problem size permits, but with many variables they usually exceed any
+// memory budget.
+class LazyShannonProblem
+    : public LinearProblem
+{
+public:
+    static const int max_vars = 8*sizeof(SetIndex);
+
+    // Column generation fails with an error if the problem grows beyond
+    // the memory budget (in bytes, 0 means unlimited).
+    explicit LazyShannonProblem(int num_vars, double budget=0);
+
+    // initial size for the given subsets, without other constraints
+    static ProblemSize estimate(int num_vars, const std::set<SetIndex>&);
+
+    void set(int row, const SparseVector&);
+    void push();
+    void pop();
+
+protected:
+    // (a, b, K) denotes I(a:b|K)>=0, and (i, i, 0) denotes H(i|rest)>=0
+    typedef std::tuple<int, int, SetIndex> Elemental;
+
+    int column(SetIndex);
+    void set_objective(const SparseVector&);
+    int solve();
+
+    int generate_columns();             // returns GLPK status
+    bool price();                       // add improving columns
+    void add_upward_closure(SetIndex);  // add all supersets
+    ProblemSize current_size() const;
+    void check_budget() const;
+    void add_elemental_rows(SetIndex);
+    void restore_elemental_rows(SetIndex);
+    int add_elemental_row(const Elemental&);
+    void set_elemental_row(int row, const Elemental&);
+
+    static SetIndex all_vars(int num_vars);
+    static void elementals_containing(
+            int num_vars, SetIndex, std::vector<Elemental>&);
+    static int elemental_terms(
+            SetIndex all, const Elemental&, SetIndex*, double*);
+
+    int num_vars;
+    SetIndex all;
+    double budget;
+    std::map<SetIndex, int> columns;
+    std::map<Elemental, int> rows;
+    SparseVector objective;
+
+    // While a scope is open, new columns and elemental rows are logged in
+    // order of creation, so that pop() only has to visit those created in
+    // the scope. 'marks' holds the size of both logs at each push().
+    std::vector<SetIndex> new_columns;
+    std::vector<Elemental> new_rows;
+    std::vector<std::pair<size_t, size_t>> marks;
+
+    // Constraints with a constant term may not be satisfiable using only
+    // the columns created so far. Therefore, each such row gets an
+    // artificial column whose sum is minimized in a first phase.
+    struct Artificial { int row, col; double value; };
+    std::vector<Artificial> artificial;
+};
+
+
+// Extreme rays of the Shannon cone for a small number of variables. An
+// unconstrained inequality I>=0 is valid if and only if I has nonnegative
+// inner product with each extreme ray, which is much cheaper to check than
+// solving the corresponding linear program. The rays are computed once with
+// the double description method and stored in a dense row-major table
+// that starts at a 32 byte boundary and whose rows are padded to a multiple
+// of 4 components, so that the optimized build can check the rays with
+// SIMD instructions.
+class ShannonCone
+{
+public:
+    // For 5 variables the cone already has more than 10**5 extreme rays.
+    static const int max_vars = 4;
+
+    explicit ShannonCone(int num_vars);
+
+    // 'rays' points into 'storage'
+    ShannonCone(const ShannonCone&) = delete;
+    ShannonCone& operator = (const ShannonCone&) = delete;
+
+    // cached instance for the given number of variables
+    static const ShannonCone& get(int num_vars);
+
+    bool check(const SparseVector&) const;
+
+    int num_rays() const { return num; }
+
+private:
+    int dim;                            // number of non-empty subsets
+    int stride;
+    int num;
+    std::vector<double> storage;
+    const double* rays;                 // aligned start of the table
+};
+
+
 class ParserOutput : public ParserCallback
 {
     int get_var_index(const std::string&);
-    int get_set_index(const ast::VarList&);     // as in 'set of variables'
+    SetIndex get_set_index(const ast::VarList&);    // as in 'set of variables'
     void add_quant_vec(SparseVector&, const ast::Quantity&);
     void add_term(SparseVector&, const ast::Term&, double scale=1);
 
@@ -80,17 +246,66 @@ public:
     Matrix inquiries;
     Matrix constraints;
 
+    std::vector<ScopeEvent> scopes;
+    int num_scopes = 0;
+    std::vector<int> open_scopes;       // numbers of currently open scopes
+
     // parser callback
     void relation(ast::Relation);
     void markov_chain(ast::MarkovChain);
     void mutual_independence(ast::MutualIndependence);
     void function_of(ast::FunctionOf);
+    void push_scope();
+    void pop_scope();
 };
 
 
 ParserOutput parse(const std::vector<std::string>&);
 
-bool check(const ParserOutput&);
+// Memory budget (in bytes) used by the functions below unless specified
+// otherwise. This keeps off problems that would exhaust the memory of a
+// typical machine with an error instead.
+const double default_budget = 4.0 * (1 << 30);
+
+// Predict the size of the problem before setting it up. In lazy mode,
+// this is the initial size before any columns are generated. Constraints
+// inside scopes are counted as if they were all present at once.
+ProblemSize estimate(const ParserOutput&, bool lazy);
+
+// Decide whether to use a LazyShannonProblem. The full ShannonTypeProblem
+// is preferred, since it decides everything with a single solve, unless
+// its estimated size exceeds the memory budget (in bytes, 0 means
+// unlimited) or it has too many variables. Throws if the problem does not
+// fit into the budget either way.
+bool select_lazy(const ParserOutput&, double budget=default_budget);
+
+// Create an empty problem of the type chosen by select_lazy().
+std::unique_ptr<LinearProblem> create_problem(
+        const ParserOutput&, double budget=default_budget);
+
+// Check the inquiry subject to the constraints outside of any scope.
+bool check(const ParserOutput&, double budget=default_budget);
+
+// Check the inquiry at the end of each scope and finally at the top level.
+// The constraints of a scope are only added and removed incrementally.
+// Returns the results in the order of the scope numbers, followed by the
+// result at the top level.
+std::vector<bool> check_scopes(const ParserOutput&,
+                               double budget=default_budget);
+
+// Minimize the (single) inquiry subject to the top-level constraints.
+double optimize(const ParserOutput&, double budget=default_budget);
+
+// Character in the input expressions that is replaced by the parameter
+// value in a sweep. It can stand for any number, e.g. a coefficient.
+const char sweep_param = '$';
+
+// Compute optimize() for each of the given parameter values. The problem
+// is only set up once. For subsequent values, only the constraints that
+// changed are updated, and the solver starts from the previous basis.
+std::vector<double> sweep(const std::vector<std::string>&,
+                          const std::vector<double>& values,
+                          double budget=default_budget);
 
 
 #endif // include guard
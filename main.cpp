@@ -4,6 +4,10 @@
 #include <string>       // getline
 #include <vector>       // vector
 #include <iterator>     // back_inserter
+#include <algorithm>    // replace
+#include <sstream>      // istringstream
+#include <stdexcept>    // runtime_error
+#include <math.h>       // floor
 
 #include "citip.hpp"
 #include "common.hpp"
@@ -12,6 +16,64 @@ using util::quoted;
 using util::line_iterator;
 
 
+// Parse a grid of the form 'START:STOP:STEP' (inclusive)
+std::vector<double> parse_range(const std::string& range)
+{
+    const double max_points = 1e6;
+    std::istringstream in(range);
+    double start, stop, step;
+    char sep1, sep2;
+    in >> start >> sep1 >> stop >> sep2 >> step;
+    if (!in || in.peek() != EOF || sep1 != ':' || sep2 != ':') {
+        throw std::runtime_error("Invalid range " + quoted(range) +
+                                 ", expected START:STOP:STEP");
+    }
+    // compare in floating point to avoid overflow (negated to catch NaN):
+    double count = floor((stop - start) / step + 1e-9) + 1;
+    if (step == 0 || !(count >= 1 && count <= max_points)) {
+        throw std::runtime_error(
+                "Invalid range " + quoted(range) + ", empty or too long");
+    }
+    int num = count;
+    std::vector<double> values(num);
+    for (int i = 0; i < num; ++i)
+        values[i] = start + i*step;
+    return values;
+}
+
+// Parse a memory size in bytes with an optional suffix K, M or G
+double parse_size(const std::string& size)
+{
+    std::istringstream in(size);
+    double bytes;
+    in >> bytes;
+    if (in && !in.eof()) {
+        switch (in.get()) {
+            case 'K': bytes *= 1 << 10; break;
+            case 'M': bytes *= 1 << 20; break;
+            case 'G': bytes *= 1 << 30; break;
+            default: in.setstate(std::ios::failbit);
+        }
+    }
+    if (!in || in.peek() != EOF || bytes < 0) {
+        throw std::runtime_error(
+                "Invalid size " + quoted(size) + ", expected e.g. 512M");
+    }
+    return bytes;
+}
+
+void print_size(const char* name, const ProblemSize& size)
+{
+    std::cout << std::fixed;
+    std::cout.precision(0);
+    std::cout << name << ": "
+        << size.rows << " rows, "
+        << size.cols << " columns, "
+        << size.nonzeros << " nonzeros, "
+        << size.memory() << " bytes" << std::endl;
+}
+
+
 int main (int argc, char *argv[])
 try
 {
@@ -19,6 +81,29 @@ try
 
     vector<string> expr;
 
+    // options start with '--', everything else are expressions:
+    bool optimize_mode = false;
+    bool estimate_mode = false;
+    double budget = default_budget;
+    string sweep_range;
+    int num_args = 1;
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg == "--optimize")
+            optimize_mode = true;
+        else if (arg == "--estimate" || arg == "--dry-run")
+            estimate_mode = true;
+        else if (arg.compare(0, 9, "--budget=") == 0)
+            budget = parse_size(arg.substr(9));
+        else if (arg.compare(0, 8, "--sweep=") == 0)
+            sweep_range = arg.substr(8);
+        else if (arg.compare(0, 2, "--") == 0)
+            throw runtime_error("Unknown option " + quoted(arg));
+        else
+            argv[num_args++] = argv[i];
+    }
+    argc = num_args;
+
     bool use_stdin = argc == 1;
 
     if (string(argv[argc-1]) == "-") {
@@ -32,7 +117,51 @@ try
         copy(line_iterator(cin), line_iterator(), back_inserter(expr));
     }
 
-    bool success = check(parse(expr));
+    if (!sweep_range.empty() && !estimate_mode) {
+        vector<double> values = parse_range(sweep_range);
+        vector<double> results = sweep(expr, values, budget);
+        for (size_t i = 0; i < values.size(); ++i)
+            cout << values[i] << '\t' << results[i] << endl;
+        return 0;
+    }
+
+    if (estimate_mode) {
+        // expressions with a sweep parameter are estimated for value zero:
+        for (auto&& line : expr)
+            replace(line.begin(), line.end(), sweep_param, '0');
+        ParserOutput out = parse(expr);
+        print_size("dense", estimate(out, false));
+        print_size("lazy", estimate(out, true));
+        bool lazy = select_lazy(out, budget);
+        cout << "mode: " << (lazy ? "lazy" : "dense") << endl;
+        return 0;
+    }
+
+    ParserOutput out = parse(expr);
+
+    if (optimize_mode) {
+        cout << optimize(out, budget) << endl;
+        return 0;
+    }
+
+    if (!out.scopes.empty()) {
+        vector<bool> results = check_scopes(out, budget);
+        bool all = true;
+        for (size_t i = 0; i < results.size(); ++i) {
+            if (i+1 < results.size())
+                cerr << "scope " << i+1 << ": ";
+            else
+                cerr << "top level: ";
+            if (results[i])
+                cerr << "TRUE" << endl;
+            else
+                cerr << "FALSE or non-Shannon type" << endl;
+            all = all && results[i];
+        }
+        return all ? 0 : 1;
+    }
+
+    bool success = check(out, budget);
 
     if (success) {
         cerr << "The information expression is TRUE." << endl;
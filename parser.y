@@ -69,6 +69,8 @@
         virtual void markov_chain(ast::MarkovChain) = 0;
         virtual void mutual_independence(ast::MutualIndependence) = 0;
         virtual void function_of(ast::FunctionOf) = 0;
+        virtual void push_scope() = 0;
+        virtual void pop_scope() = 0;
     };
 }
 
@@ -102,6 +104,8 @@ statement    : %empty           { /* allow empty (or pure comment) lines */ }
              | mutual_indep     { cb->mutual_independence(move($1)); }
              | markov_chain     { cb->markov_chain(move($1)); }
              | determ_depen     { cb->function_of(move($1)); }
+             | '{'              { cb->push_scope(); }
+             | '}'              { cb->pop_scope(); }
              ;
 
     /* statements */